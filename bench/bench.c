@@ -0,0 +1,424 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define GL_GLEXT_PROTOTYPES
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <GLFW/glfw3.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#include "valo/vlgl.h"
+#include "valo/player.h"
+
+#ifndef VL_BENCH_REV
+#define VL_BENCH_REV "unknown"
+#endif
+
+#define BENCH_ROUNDS 7
+#define BENCH_PRECISION_MAX 6
+#define BENCH_CLIP_FRAMES 60
+
+static const double BENCH_ROUND_NS = 5e7;
+static const int BENCH_WIDTH = 3840;
+static const int BENCH_HEIGHT = 1920;
+
+typedef void (*bench_fn)(void *arg);
+
+static const char *filter;
+static char host[64];
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Grow the iteration count until one round takes BENCH_ROUND_NS, then time
+ * BENCH_ROUNDS rounds and print one JSON object per line, so results from
+ * two commits on the same host can be joined on bench and case.
+ */
+static void bench_run(const char *bench, const char *name, bench_fn fn, void *arg)
+{
+  double ns[BENCH_ROUNDS];
+  char id[128];
+  long iters = 1;
+
+  snprintf(id, sizeof(id), "%s/%s", bench, name);
+  if (filter && !strstr(id, filter)) {
+    return;
+  }
+
+  for (;;) {
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) fn(arg);
+    if (now_ns() - start >= BENCH_ROUND_NS || iters >= 1L << 30) break;
+    iters *= 2;
+  }
+
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    double start = now_ns();
+    for (long i = 0; i < iters; i++) fn(arg);
+    ns[r] = (now_ns() - start) / iters;
+  }
+  qsort(ns, BENCH_ROUNDS, sizeof(double), cmp_double);
+
+  printf("{\"rev\":\"%s\",\"host\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"iters\":%ld,"
+      "\"ns_min\":%.0f,\"ns_median\":%.0f,\"ns_max\":%.0f}\n",
+      VL_BENCH_REV, host, bench, name, iters, ns[0], ns[BENCH_ROUNDS/2], ns[BENCH_ROUNDS-1]);
+  fflush(stdout);
+}
+
+typedef struct PolyArg {
+  enum poly_type type;
+  int precision;
+} PolyArg;
+
+static void bench_poly(void *arg)
+{
+  PolyArg *a = arg;
+  poly_destroy(poly_create(a->type, a->precision));
+}
+
+static void run_poly(void)
+{
+  static const char *names[] = { [POLY_CUBE] = "cylinder", [POLY_ICOSAHEDRON] = "sphere" };
+  static const enum poly_type types[] = { POLY_CUBE, POLY_ICOSAHEDRON };
+  char name[32];
+
+  for (int t = 0; t < 2; t++) {
+    for (int p = 1; p <= BENCH_PRECISION_MAX; p++) {
+      PolyArg a = { types[t], p };
+      snprintf(name, sizeof(name), "%s/%d", names[types[t]], p);
+      bench_run("poly_create", name, bench_poly, &a);
+    }
+  }
+}
+
+typedef struct Frame {
+  enum AVPixelFormat format;
+  int bps;
+  uint8_t *data[4];
+  int linesize[4];
+} Frame;
+
+static void frame_alloc(Frame *f, enum AVPixelFormat format, int bps)
+{
+  f->format = format;
+  f->bps = bps;
+  av_image_alloc(f->data, f->linesize, BENCH_WIDTH, BENCH_HEIGHT, format, 32);
+  for (int y = 0; y < BENCH_HEIGHT; y++) {
+    for (int x = 0; x < f->linesize[0]; x++) {
+      f->data[0][y * f->linesize[0] + x] = x ^ y;
+    }
+  }
+  for (int p = 1; p < 4 && f->data[p]; p++) {
+    memset(f->data[p], 0x80, f->linesize[p] * (BENCH_HEIGHT+1)/2);
+  }
+}
+
+typedef struct ConvertArg {
+  Frame *src;
+  Frame *dst;
+  struct SwsContext *sws;
+} ConvertArg;
+
+static void bench_sws(void *arg)
+{
+  ConvertArg *a = arg;
+  sws_scale(a->sws, (const uint8_t * const*)a->src->data, a->src->linesize, 0, BENCH_HEIGHT, a->dst->data, a->dst->linesize);
+}
+
+typedef struct CopyArg {
+  VLImage *img;
+  AVFrame *frame;
+} CopyArg;
+
+static void bench_copy(void *arg)
+{
+  CopyArg *a = arg;
+  VLPlayer_copy(a->img, a->frame);
+}
+
+static void run_convert(Frame *nv12, Frame *p010)
+{
+  Frame *srcs[] = { nv12, p010 };
+  enum vl_pix_fmt formats[] = { VL_PIX_FMT_NV12, VL_PIX_FMT_P010 };
+  const char *names[] = { "nv12", "p010" };
+  AVFrame *frame = av_frame_alloc();
+  Frame yuv, packed;
+  VLImage img;
+
+  frame_alloc(&yuv, AV_PIX_FMT_YUV420P, 1);
+  frame_alloc(&packed, p010->format, 2);
+
+  for (int i = 0; i < 2; i++) {
+    ConvertArg a = { srcs[i], &yuv, NULL };
+    CopyArg c = { &img, frame };
+    a.sws = sws_getCachedContext(NULL, BENCH_WIDTH, BENCH_HEIGHT, srcs[i]->format, BENCH_WIDTH, BENCH_HEIGHT, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+    bench_run("convert_sws_scale", names[i], bench_sws, &a);
+    sws_freeContext(a.sws);
+
+    memset(&img, 0, sizeof(VLImage));
+    img.width = BENCH_WIDTH;
+    img.height = BENCH_HEIGHT;
+    img.format = formats[i];
+    img.y = packed.data[0];
+    img.u = packed.data[0] + BENCH_WIDTH * BENCH_HEIGHT * srcs[i]->bps;
+    for (int p = 0; p < 2; p++) {
+      frame->data[p] = srcs[i]->data[p];
+      frame->linesize[p] = srcs[i]->linesize[p];
+    }
+    bench_run("convert_copy", names[i], bench_copy, &c);
+  }
+
+  av_frame_free(&frame);
+  av_free(yuv.data[0]);
+  av_free(packed.data[0]);
+}
+
+typedef struct GLArg {
+  VLGL *gl;
+  VLImage *img;
+} GLArg;
+
+static void image_from(VLImage *img, Frame *f, enum vl_pix_fmt format)
+{
+  memset(img, 0, sizeof(VLImage));
+  img->width = BENCH_WIDTH;
+  img->height = BENCH_HEIGHT;
+  img->format = format;
+  img->y = f->data[0];
+  img->u = f->data[1];
+  img->v = format == VL_PIX_FMT_YUV420P ? f->data[2] : NULL;
+}
+
+static void bench_upload(void *arg)
+{
+  GLArg *a = arg;
+  VLGL_upload(a->gl, a->img);
+  glFinish();
+}
+
+static void bench_render(void *arg)
+{
+  GLArg *a = arg;
+  VLGL_render(a->gl, a->img);
+  glFinish();
+}
+
+/**
+ * Texture upload and the full render pass, in a hidden 1920x1080 window.
+ * The upload bench leaves packed formats in tightly packed planes, as the
+ * player hands them over.
+ */
+static void run_gl(Frame *yuv, Frame *nv12, Frame *p010)
+{
+  Frame *srcs[] = { yuv, nv12, p010 };
+  enum vl_pix_fmt formats[] = { VL_PIX_FMT_YUV420P, VL_PIX_FMT_NV12, VL_PIX_FMT_P010 };
+  const char *names[] = { "yuv420p", "nv12", "p010" };
+  GLFWwindow *window;
+  VLImage img;
+  char name[32];
+  VLGL *gl;
+
+  if (!glfwInit()) {
+    fprintf(stderr, "glfwInit failed, skipping GL benchmarks\n");
+    return;
+  }
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+  window = glfwCreateWindow(1920, 1080, "valo-bench", NULL, NULL);
+  if (!window) {
+    fprintf(stderr, "glfwCreateWindow failed, skipping GL benchmarks\n");
+    glfwTerminate();
+    return;
+  }
+  glfwMakeContextCurrent(window);
+  glfwSwapInterval(0);
+
+  gl = VLGL_construct(POLY_ICOSAHEDRON, BENCH_PRECISION_MAX);
+  VLGL_viewport(gl, 1920, 1080);
+  glViewport(0, 0, 1920, 1080);
+
+  for (int i = 0; i < 3; i++) {
+    GLArg a = { gl, &img };
+    image_from(&img, srcs[i], formats[i]);
+    bench_run("upload", names[i], bench_upload, &a);
+  }
+
+  image_from(&img, yuv, VL_PIX_FMT_YUV420P);
+  for (int z = 1; z <= 3; z++) {
+    GLArg a = { gl, &img };
+    VLGL_reset(gl);
+    VLGL_zoom(gl, 1 - z);
+    snprintf(name, sizeof(name), "yuv420p/zoom%d", z);
+    bench_run("render", name, bench_render, &a);
+  }
+
+  VLGL_destroy(gl);
+  glfwDestroyWindow(window);
+  glfwTerminate();
+}
+
+typedef struct DecodeArg {
+  AVCodecContext *dec;
+  AVFrame *frame;
+  AVPacket packets[BENCH_CLIP_FRAMES + 8];
+  int n_packets;
+} DecodeArg;
+
+static void bench_decode(void *arg)
+{
+  DecodeArg *a = arg;
+
+  avcodec_flush_buffers(a->dec);
+  for (int i = 0; i < a->n_packets; i++) {
+    avcodec_send_packet(a->dec, &(a->packets[i]));
+    while (avcodec_receive_frame(a->dec, a->frame) == 0);
+  }
+}
+
+/**
+ * Encode a synthetic clip in memory, then time decoding all of its packets.
+ * The result is per clip of BENCH_CLIP_FRAMES frames.
+ */
+static void run_decode(Frame *yuv)
+{
+  static const enum AVCodecID codecs[] = { AV_CODEC_ID_MPEG4, AV_CODEC_ID_MPEG1VIDEO };
+  static const char *names[] = { "mpeg4", "mpeg1video" };
+
+  for (int c = 0; c < 2; c++) {
+    AVCodec *codec = avcodec_find_encoder(codecs[c]);
+    AVCodecContext *enc = NULL;
+    AVFrame *frame = av_frame_alloc();
+    DecodeArg a = { .n_packets = 0 };
+    char name[32];
+
+    if (codec == NULL || (enc = avcodec_alloc_context3(codec)) == NULL) {
+      fprintf(stderr, "no %s encoder, skipping decode benchmark\n", names[c]);
+      av_frame_free(&frame);
+      continue;
+    }
+    enc->width = BENCH_WIDTH;
+    enc->height = BENCH_HEIGHT;
+    enc->pix_fmt = AV_PIX_FMT_YUV420P;
+    enc->time_base = (AVRational){ 1, 30 };
+    enc->gop_size = 30;
+    enc->bit_rate = 20000000;
+    if (avcodec_open2(enc, codec, NULL) < 0) {
+      fprintf(stderr, "cannot open %s encoder, skipping decode benchmark\n", names[c]);
+      avcodec_free_context(&enc);
+      av_frame_free(&frame);
+      continue;
+    }
+
+    frame->width = BENCH_WIDTH;
+    frame->height = BENCH_HEIGHT;
+    frame->format = AV_PIX_FMT_YUV420P;
+    for (int p = 0; p < 3; p++) {
+      frame->data[p] = yuv->data[p];
+      frame->linesize[p] = yuv->linesize[p];
+    }
+    for (int i = 0; i <= BENCH_CLIP_FRAMES; i++) {
+      if (i < BENCH_CLIP_FRAMES) {
+        frame->pts = i;
+        yuv->data[0][i * 4] ^= 0xff;
+      }
+      if (avcodec_send_frame(enc, i < BENCH_CLIP_FRAMES ? frame : NULL) < 0) {
+        break;
+      }
+      while (a.n_packets < BENCH_CLIP_FRAMES + 8) {
+        AVPacket *pkt = &(a.packets[a.n_packets]);
+        av_init_packet(pkt);
+        pkt->data = NULL;
+        pkt->size = 0;
+        if (avcodec_receive_packet(enc, pkt) < 0) {
+          break;
+        }
+        a.n_packets++;
+      }
+    }
+    avcodec_free_context(&enc);
+    av_frame_free(&frame);
+
+    a.dec = avcodec_alloc_context3(avcodec_find_decoder(codecs[c]));
+    a.frame = av_frame_alloc();
+    avcodec_open2(a.dec, avcodec_find_decoder(codecs[c]), NULL);
+    snprintf(name, sizeof(name), "%s/%dx%d/%d", names[c], BENCH_WIDTH, BENCH_HEIGHT, BENCH_CLIP_FRAMES);
+    bench_run("decode", name, bench_decode, &a);
+
+    for (int i = 0; i < a.n_packets; i++) {
+      av_packet_unref(&(a.packets[i]));
+    }
+    avcodec_free_context(&(a.dec));
+    av_frame_free(&(a.frame));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  Frame yuv, nv12, p010;
+
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  filter = argc == 2 ? argv[1] : NULL;
+  gethostname(host, sizeof(host) - 1);
+
+  avcodec_register_all();
+  frame_alloc(&yuv, AV_PIX_FMT_YUV420P, 1);
+  frame_alloc(&nv12, AV_PIX_FMT_NV12, 1);
+  frame_alloc(&p010, AV_PIX_FMT_P010LE, 2);
+
+  run_poly();
+  run_convert(&nv12, &p010);
+  run_gl(&yuv, &nv12, &p010);
+  run_decode(&yuv);
+
+  av_free(yuv.data[0]);
+  av_free(nv12.data[0]);
+  av_free(p010.data[0]);
+  return EXIT_SUCCESS;
+}
@@ -30,11 +30,21 @@
 
 #ifndef _VL_PLAYER_H
 #define _VL_PLAYER_H
+#include <stdint.h>
 #include <pthread.h>
+#include "valo/stats.h"
 
 typedef int64_t vl_time;
 typedef struct VLTimer VLTimer;
 typedef struct VLGL VLGL;
+typedef struct VLPool VLPool;
+struct AVFrame;
+
+enum vl_pix_fmt {
+  VL_PIX_FMT_YUV420P,
+  VL_PIX_FMT_NV12,
+  VL_PIX_FMT_P010,
+};
 
 typedef struct VLImage {
   uint8_t *data;
@@ -43,7 +53,9 @@ typedef struct VLImage {
   uint8_t *v;
   int width;
   int height;
+  enum vl_pix_fmt format;
   vl_time pts;
+  uint64_t seq;
 } VLImage;
 
 typedef struct VLPlayer {
@@ -52,6 +64,10 @@ typedef struct VLPlayer {
   VLTimer *timer;
   VLImage *image;
   pthread_t thread;
+  VLPool *pool;
+  uint64_t reallocs;
+  VLTiming decode;
+  VLTiming convert;
 } VLPlayer;
 
 VLPlayer *VLPlayer_construct(VLGL *gl, const char *url);
@@ -62,5 +78,9 @@ void VLPlayer_pause(VLPlayer *player);
 
 void VLPlayer_seek(VLPlayer *player, vl_time time);
 
+vl_time VLPlayer_current(VLPlayer *player);
+
+void VLPlayer_copy(VLImage *img, struct AVFrame *frame);
+
 
 #endif
@@ -0,0 +1,60 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _VL_POOL_H
+#define _VL_POOL_H
+#include <stddef.h>
+#include <stdint.h>
+#include <libavutil/buffer.h>
+
+#define VL_POOL_FRAMES 8
+#define VL_POOL_PAGE (2 << 20)
+#define VL_POOL_ALIGN 64
+
+typedef struct VLPool VLPool;
+
+typedef struct VLPoolStats {
+  uint64_t served;
+  uint64_t refills;
+  uint64_t overflow;
+  size_t mapped_bytes;
+} VLPoolStats;
+
+VLPool *VLPool_construct(int size, int capacity);
+
+void VLPool_destroy(VLPool *pool);
+
+AVBufferRef *VLPool_get(VLPool *pool);
+
+int VLPool_size(VLPool *pool);
+
+void VLPool_stats(VLPoolStats *stats);
+
+#endif
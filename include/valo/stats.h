@@ -0,0 +1,65 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _VL_STATS_H
+#define _VL_STATS_H
+#include <stdio.h>
+#include <stdint.h>
+
+#define VL_HISTOGRAM_BINS 200
+#define VL_HISTOGRAM_STEP 0.5
+
+typedef struct VLHistogram {
+  const char *name;
+  uint64_t bins[VL_HISTOGRAM_BINS + 1];
+  uint64_t count;
+  double sum;
+  double max;
+} VLHistogram;
+
+typedef struct VLTiming {
+  double last;
+  double avg;
+  double max;
+} VLTiming;
+
+void VLHistogram_add(VLHistogram *h, double ms);
+
+double VLHistogram_mean(const VLHistogram *h);
+
+double VLHistogram_percentile(const VLHistogram *h, double p);
+
+void VLHistogram_print(const VLHistogram *h, FILE *fp);
+
+double VLTiming_now(void);
+
+void VLTiming_add(VLTiming *t, double ms);
+
+#endif
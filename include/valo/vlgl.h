@@ -30,40 +30,102 @@
 
 #ifndef _VL_GL_H
 #define _VL_GL_H
+#include <stdbool.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include "3dm/3dm.h"
 #include "3dm/poly.h"
+#include "valo/stats.h"
+
+#define VLGL_LOD_MAX 8
+#define VLGL_LOD_ERROR 0.5
+#define VLGL_BIN_GRID 4
+#define VLGL_BINS (6 * VLGL_BIN_GRID * VLGL_BIN_GRID)
+#define VLGL_VIEWS_MAX 8
 
 typedef struct VLImage VLImage;
 
-typedef struct VLGL {
-  GLuint program;
+enum vlgl_stereo {
+  VLGL_STEREO_MONO,
+  VLGL_STEREO_TB,
+  VLGL_STEREO_SBS,
+};
+
+enum vlgl_output {
+  VLGL_OUTPUT_MONO,
+  VLGL_OUTPUT_ANAGLYPH,
+  VLGL_OUTPUT_SBS,
+  VLGL_OUTPUT_TB,
+};
+
+enum vlgl_projection {
+  VLGL_PROJECTION_STEREO,
+  VLGL_PROJECTION_RECTILINEAR,
+};
+
+typedef struct VLView {
+  GLfloat x, y, w, h;
+  GLfloat yaw;
+  bool auto_yaw;
+  GLfloat fov;
+  enum vlgl_projection projection;
+  mat4d m_proj;
+  int lod;
+} VLView;
+
+typedef struct VLMesh {
   GLuint vbo;
   GLuint tbo;
   GLuint ebo;
   GLuint vao;
+  GLsizei i_len;
+  GLsizei bin_first[VLGL_BINS];
+  GLsizei bin_count[VLGL_BINS];
+  GLfloat bin_dir[VLGL_BINS][3];
+  GLfloat bin_radius[VLGL_BINS];
+  GLfloat edge;
+  int precision;
+} VLMesh;
+
+typedef struct VLGL {
+  GLuint program;
+  GLuint dbo;
   GLuint v_position;
   GLuint v_texcoord;
   GLuint u_model;
   GLuint u_view;
   GLuint u_proj;
   GLuint u_tex;
+  GLuint u_eye;
+  GLuint u_out;
+  GLuint u_mask;
+  GLuint u_projection;
+  GLuint u_format;
   GLuint textures[3];
   GLuint samplers[3];
   mat4d m_model;
   mat4d m_view;
-  mat4d m_proj;
   mat4d m_tex;
-  poly_t *poly;
+  VLMesh meshes[VLGL_LOD_MAX];
+  int n_meshes;
+  VLView views[VLGL_VIEWS_MAX];
+  int n_views;
   GLfloat vw, vh, vz;
   GLfloat rotate_v;
+  enum vlgl_stereo stereo;
+  enum vlgl_output output;
+  size_t mesh_bytes;
+  size_t texture_bytes;
+  int format;
+  VLTiming upload;
 } VLGL;
 
 VLGL *VLGL_construct(enum poly_type type, int precision);
 
 void VLGL_destroy(VLGL *gl);
 
+void VLGL_upload(VLGL *gl, struct VLImage *img);
+
 void VLGL_render(VLGL *gl, struct VLImage *img);
 
 void VLGL_viewport(VLGL *gl, int w, int h);
@@ -74,6 +136,15 @@ void VLGL_zoom(VLGL *gl, double inc);
 
 void VLGL_reset(VLGL *gl);
 
+void VLGL_stereo(VLGL *gl, enum vlgl_stereo stereo, enum vlgl_output output);
+
+void VLGL_views(VLGL *gl, int n);
+
+/* A NAN yaw keeps the view tiled next to its neighbours. */
+void VLGL_view(VLGL *gl, int i, GLfloat yaw, GLfloat fov, enum vlgl_projection projection);
+
+void VLGL_projection(VLGL *gl, enum vlgl_projection projection);
+
 void VLGL_version(void);
 
 #endif
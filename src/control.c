@@ -0,0 +1,328 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "valo/control.h"
+#include "valo/stats.h"
+
+static const int CONTROL_POLL_MS = 100;
+static const double CONTROL_WATCH_MS = 1000;
+
+typedef struct VLClient {
+  int fd;
+  bool watch;
+  bool overflow;
+  size_t len;
+  char line[VL_CONTROL_LINE];
+  size_t out_len;
+  char out[VL_CONTROL_OUT];
+} VLClient;
+
+struct VLControl {
+  bool abort;
+  int fd;
+  char *path;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  VLClient clients[VL_CONTROL_CLIENTS];
+  char queue[VL_CONTROL_QUEUE][VL_CONTROL_LINE];
+  int head, n_queue;
+  char telemetry[VL_CONTROL_LINE];
+};
+
+static void VLControl_close(VLClient *client)
+{
+  close(client->fd);
+  client->fd = -1;
+}
+
+static void VLControl_flush(VLClient *client)
+{
+  ssize_t n = send(client->fd, client->out, client->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    VLControl_close(client);
+  } else if (n > 0) {
+    client->out_len -= n;
+    memmove(client->out, client->out + n, client->out_len);
+  }
+}
+
+/**
+ * Replies are queued whole in the client's output buffer and written out as
+ * the socket accepts them, so a slow reader never sees half a line. A client
+ * that falls a whole buffer behind is dropped.
+ */
+static void VLControl_send(VLClient *client, const char *msg)
+{
+  size_t len = strlen(msg);
+
+  if (client->out_len + len > VL_CONTROL_OUT) {
+    VLControl_close(client);
+    return;
+  }
+  memcpy(client->out + client->out_len, msg, len);
+  client->out_len += len;
+  VLControl_flush(client);
+}
+
+static void VLControl_telemetry(VLControl *ctl, char *buf)
+{
+  pthread_mutex_lock(&(ctl->lock));
+  snprintf(buf, VL_CONTROL_LINE + 1, "%s\n", ctl->telemetry);
+  pthread_mutex_unlock(&(ctl->lock));
+}
+
+/**
+ * `watch` and `stats` are answered here, everything else is queued as one
+ * batch for the render thread to apply at its next frame boundary.
+ */
+static void VLControl_line(VLControl *ctl, VLClient *client, const char *line)
+{
+  char buf[VL_CONTROL_LINE + 1];
+
+  if (!strcmp(line, "watch")) {
+    client->watch = true;
+  } else if (!strcmp(line, "unwatch")) {
+    client->watch = false;
+  } else if (!strcmp(line, "stats")) {
+    VLControl_telemetry(ctl, buf);
+    VLControl_send(client, buf);
+  } else if (line[0] != '\0') {
+    bool queued = false;
+    pthread_mutex_lock(&(ctl->lock));
+    if (ctl->n_queue < VL_CONTROL_QUEUE) {
+      snprintf(ctl->queue[(ctl->head + ctl->n_queue) % VL_CONTROL_QUEUE], VL_CONTROL_LINE, "%s", line);
+      ctl->n_queue++;
+      queued = true;
+    }
+    pthread_mutex_unlock(&(ctl->lock));
+    if (!queued) {
+      VLControl_send(client, "error queue full\n");
+    }
+  }
+}
+
+static void VLControl_read(VLControl *ctl, VLClient *client)
+{
+  char buf[VL_CONTROL_LINE];
+  ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+
+  if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+    VLControl_close(client);
+    return;
+  }
+
+  for (ssize_t i = 0; i < n && client->fd >= 0; i++) {
+    if (buf[i] == '\n') {
+      client->line[client->len] = '\0';
+      if (client->len > 0 && client->line[client->len-1] == '\r') {
+        client->line[client->len-1] = '\0';
+      }
+      if (client->overflow) {
+        VLControl_send(client, "error line too long\n");
+      } else {
+        VLControl_line(ctl, client, client->line);
+      }
+      client->len = 0;
+      client->overflow = false;
+    } else if (client->len < VL_CONTROL_LINE - 1) {
+      client->line[client->len++] = buf[i];
+    } else {
+      client->overflow = true;
+    }
+  }
+}
+
+static void *VLControl_thread(void *arg)
+{
+  VLControl *ctl = arg;
+  struct pollfd fds[VL_CONTROL_CLIENTS + 1];
+  double watched = VLTiming_now();
+
+  while (!ctl->abort) {
+    int n = 0;
+    fds[n].fd = ctl->fd;
+    fds[n++].events = POLLIN;
+    for (int i = 0; i < VL_CONTROL_CLIENTS; i++) {
+      fds[n].fd = ctl->clients[i].fd;
+      fds[n++].events = POLLIN | (ctl->clients[i].out_len > 0 ? POLLOUT : 0);
+    }
+
+    if (poll(fds, n, CONTROL_POLL_MS) > 0) {
+      if (fds[0].revents & POLLIN) {
+        int fd = accept(ctl->fd, NULL, NULL);
+        for (int i = 0; fd >= 0 && i < VL_CONTROL_CLIENTS; i++) {
+          if (ctl->clients[i].fd < 0) {
+            memset(&(ctl->clients[i]), 0, sizeof(VLClient));
+            ctl->clients[i].fd = fd;
+            fd = -1;
+          }
+        }
+        if (fd >= 0) {
+          close(fd);
+        }
+      }
+      for (int i = 0; i < VL_CONTROL_CLIENTS; i++) {
+        if (ctl->clients[i].fd >= 0 && fds[i+1].fd >= 0 && (fds[i+1].revents & POLLOUT)) {
+          VLControl_flush(&(ctl->clients[i]));
+        }
+        if (ctl->clients[i].fd >= 0 && fds[i+1].fd >= 0 && (fds[i+1].revents & ~POLLOUT)) {
+          VLControl_read(ctl, &(ctl->clients[i]));
+        }
+      }
+    }
+
+    if (VLTiming_now() - watched >= CONTROL_WATCH_MS) {
+      char buf[VL_CONTROL_LINE + 1];
+      watched = VLTiming_now();
+      VLControl_telemetry(ctl, buf);
+      for (int i = 0; i < VL_CONTROL_CLIENTS; i++) {
+        if (ctl->clients[i].fd >= 0 && ctl->clients[i].watch) {
+          VLControl_send(&(ctl->clients[i]), buf);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+VLControl *VLControl_construct(const char *path)
+{
+  VLControl *ctl = NULL;
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t mask;
+  int ret = -1;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "[Control: %d] socket path too long: %s\n", __LINE__, path);
+    return NULL;
+  }
+
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "[Control: %d] %s exists and is not a socket\n", __LINE__, path);
+      return NULL;
+    }
+    unlink(path);
+  }
+
+  ctl = calloc(1, sizeof(VLControl));
+  if (ctl == NULL) {
+    fprintf(stderr, "[OOM: %d] VLControl_construct\n", __LINE__);
+    return NULL;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  ctl->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (ctl->fd >= 0) {
+    mask = umask(0177);
+    ret = bind(ctl->fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+  }
+  if (ctl->fd < 0 || ret < 0 || listen(ctl->fd, VL_CONTROL_CLIENTS) < 0) {
+    fprintf(stderr, "[Control: %d] %s: %s\n", __LINE__, path, strerror(errno));
+    if (ctl->fd >= 0) close(ctl->fd);
+    free(ctl);
+    return NULL;
+  }
+
+  ctl->path = strdup(path);
+  strcpy(ctl->telemetry, "{}");
+  for (int i = 0; i < VL_CONTROL_CLIENTS; i++) {
+    ctl->clients[i].fd = -1;
+  }
+  pthread_mutex_init(&(ctl->lock), NULL);
+  pthread_create(&(ctl->thread), NULL, VLControl_thread, ctl);
+
+  return ctl;
+}
+
+void VLControl_destroy(VLControl *ctl)
+{
+  ctl->abort = true;
+  pthread_join(ctl->thread, NULL);
+  for (int i = 0; i < VL_CONTROL_CLIENTS; i++) {
+    if (ctl->clients[i].fd >= 0) close(ctl->clients[i].fd);
+  }
+  close(ctl->fd);
+  unlink(ctl->path);
+  pthread_mutex_destroy(&(ctl->lock));
+  free(ctl->path);
+
+  free(ctl);
+}
+
+/**
+ * Called from the render thread. Never waits for the lock: if the control
+ * thread holds it, the batch is simply picked up on the next frame.
+ */
+int VLControl_poll(VLControl *ctl, char *batch, size_t len)
+{
+  int ret = 0;
+
+  if (pthread_mutex_trylock(&(ctl->lock)) != 0) {
+    return 0;
+  }
+  if (ctl->n_queue > 0) {
+    snprintf(batch, len, "%s", ctl->queue[ctl->head]);
+    ctl->head = (ctl->head + 1) % VL_CONTROL_QUEUE;
+    ctl->n_queue--;
+    ret = 1;
+  }
+  pthread_mutex_unlock(&(ctl->lock));
+  return ret;
+}
+
+void VLControl_publish(VLControl *ctl, const char *telemetry)
+{
+  if (pthread_mutex_trylock(&(ctl->lock)) != 0) {
+    return;
+  }
+  snprintf(ctl->telemetry, VL_CONTROL_LINE, "%s", telemetry);
+  pthread_mutex_unlock(&(ctl->lock));
+}
@@ -33,15 +33,19 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <pthread.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
 #include <libavutil/time.h>
+#include <libavutil/imgutils.h>
 #include <libswscale/swscale.h>
 #include "valo/vlgl.h"
 #include "valo/player.h"
+#include "valo/stats.h"
+#include "valo/pool.h"
 
 static const struct timespec TIMER_TEN_MILLI = { 0, 1e7 };
 static const vl_time TIMER_SEEK_NORMAL = -7;
@@ -80,6 +84,90 @@ static int ffmpeg_interrupt_cb(void *opaque)
   return timer && timer->abort;
 }
 
+static enum vl_pix_fmt VLPlayer_format(int pix_fmt)
+{
+  switch (pix_fmt) {
+    case AV_PIX_FMT_NV12:
+      return VL_PIX_FMT_NV12;
+    case AV_PIX_FMT_P010LE:
+      return VL_PIX_FMT_P010;
+    default:
+      return VL_PIX_FMT_YUV420P;
+  }
+}
+
+/**
+ * NV12 and P010 frames keep their layout, one luma plane and one
+ * interleaved chroma plane converted in the fragment shader, but both
+ * planes are still copied in full into the player image so the decoder can
+ * reuse its frame. What is saved is the swscale pass, not the copy.
+ * Anything else goes through swscale to 8-bit planar YUV420P.
+ */
+void VLPlayer_copy(VLImage *img, AVFrame *frame)
+{
+  int bps = img->format == VL_PIX_FMT_P010 ? 2 : 1;
+
+  av_image_copy_plane(img->y, img->width * bps, frame->data[0], frame->linesize[0], img->width * bps, img->height);
+  av_image_copy_plane(img->u, (img->width+1)/2 * 2 * bps, frame->data[1], frame->linesize[1], (img->width+1)/2 * 2 * bps, (img->height+1)/2);
+}
+
+/**
+ * Decoded frames come from a pool of huge-page buffers sized to the stream,
+ * so steady-state decoding recycles the same few frames instead of going
+ * back to the allocator. The width is widened until every plane's stride
+ * is aligned, as libavcodec does, so chroma strides stay half the luma
+ * stride. Hardware frames and decoders that can't take caller-provided
+ * buffers (no DR1) use the default path.
+ */
+static int VLPlayer_get_buffer(AVCodecContext *vcc, AVFrame *frame, int flags)
+{
+  VLPlayer *player = vcc->opaque;
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+  int w = frame->width, h = frame->height, size, unaligned;
+  int align[AV_NUM_DATA_POINTERS], linesize[4];
+  uint8_t *data[4];
+
+  if (!(vcc->codec->capabilities & AV_CODEC_CAP_DR1) || desc == NULL || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+    return avcodec_default_get_buffer2(vcc, frame, flags);
+  }
+
+  avcodec_align_dimensions2(vcc, &w, &h, align);
+  do {
+    if (av_image_fill_linesizes(linesize, frame->format, w) < 0) {
+      return avcodec_default_get_buffer2(vcc, frame, flags);
+    }
+    w += w & ~(w - 1);
+    unaligned = 0;
+    for (int i = 0; i < 4; i++) {
+      unaligned |= linesize[i] % FFMAX(align[i], VL_POOL_ALIGN);
+    }
+  } while (unaligned);
+  size = av_image_fill_pointers(data, frame->format, h, NULL, linesize);
+  if (size < 0) {
+    return avcodec_default_get_buffer2(vcc, frame, flags);
+  }
+  size += 16 + VL_POOL_ALIGN;
+
+  if (player->pool == NULL || VLPool_size(player->pool) != size) {
+    if (player->pool) VLPool_destroy(player->pool);
+    player->pool = VLPool_construct(size, VL_POOL_FRAMES);
+    if (player->pool == NULL) {
+      return AVERROR(ENOMEM);
+    }
+  }
+
+  frame->buf[0] = VLPool_get(player->pool);
+  if (frame->buf[0] == NULL) {
+    return AVERROR(ENOMEM);
+  }
+  av_image_fill_pointers(frame->data, frame->format, h, frame->buf[0]->data, linesize);
+  for (int i = 0; i < 4; i++) {
+    frame->linesize[i] = linesize[i];
+  }
+  frame->extended_data = frame->data;
+  return 0;
+}
+
 static void *VLPlayer_thread(void *arg)
 {
   VLPlayer *player = arg;
@@ -94,7 +182,6 @@ static void *VLPlayer_thread(void *arg)
   AVPacket packet, *pkt = &packet;
   struct SwsContext *sws = NULL;
   int vi = -1, ret = 0;
-  int got_frame;
 
   av_register_all();
   avformat_network_init();
@@ -103,22 +190,36 @@ static void *VLPlayer_thread(void *arg)
   ic->interrupt_callback.opaque = timer;
   ic->interrupt_callback.callback = ffmpeg_interrupt_cb;
 
-  avformat_open_input(&ic, player->url, NULL, NULL);
+  ret = avformat_open_input(&ic, player->url, NULL, NULL);
+  if (ret < 0) {
+    fprintf(stderr, "avformat_open_input %s %d\n", player->url, ret);
+    avformat_network_deinit();
+    return 0;
+  }
   av_dump_format(ic, 0, player->url, 0);
   avformat_find_stream_info(ic, NULL);
 
   for (unsigned i = 0; i < ic->nb_streams; i++) {
-    if (ic->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+    if (ic->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
       vs = ic->streams[i];
       vi = i;
       break;
     }
   }
+  if (vs == NULL) {
+    fprintf(stderr, "no video stream in %s\n", player->url);
+    avformat_close_input(&ic);
+    avformat_network_deinit();
+    return 0;
+  }
 
-  vcc = vs->codec;
-  vc = avcodec_find_decoder(vcc->codec_id);
+  vc = avcodec_find_decoder(vs->codecpar->codec_id);
+  vcc = avcodec_alloc_context3(vc);
+  avcodec_parameters_to_context(vcc, vs->codecpar);
+  vcc->opaque = player;
+  vcc->get_buffer2 = VLPlayer_get_buffer;
   avcodec_open2(vcc, vc, NULL);
-  frame = avcodec_alloc_frame();
+  frame = av_frame_alloc();
 
   timer->duration = ic->duration;
 
@@ -136,24 +237,46 @@ static void *VLPlayer_thread(void *arg)
 
     if (av_read_frame(ic, pkt) >= 0) {
       if (pkt->stream_index == vi) {
-        ret = avcodec_decode_video2(vcc, frame, &got_frame, pkt);
+        double start = VLTiming_now();
+        ret = avcodec_send_packet(vcc, pkt);
         if (ret < 0) {
-          fprintf(stderr, "avcodec_decode_video2 %d\n", ret);
-        } else if (got_frame) {
-          if (img->width != frame->width || img->height != frame->height) {
-            if (_frame) av_free(_frame);
-            if (img->data) free(img->data);
-            _frame = avcodec_alloc_frame();
-            img->data = av_malloc(avpicture_get_size(PIX_FMT_YUV420P, frame->width, frame->height) * sizeof(uint8_t));
-            avpicture_fill((AVPicture *)_frame, img->data, PIX_FMT_YUV420P, frame->width, frame->height);
-            img->y = _frame->data[0];
-            img->u = _frame->data[1];
-            img->v = _frame->data[2];
+          fprintf(stderr, "avcodec_send_packet %d\n", ret);
+        }
+        while (ret >= 0 && avcodec_receive_frame(vcc, frame) >= 0) {
+          VLTiming_add(&(player->decode), VLTiming_now() - start);
+          enum vl_pix_fmt format = VLPlayer_format(frame->format);
+          if (img->width != frame->width || img->height != frame->height || img->format != format) {
+            av_frame_free(&_frame);
+            if (img->data) av_free(img->data);
+            _frame = av_frame_alloc();
+            player->reallocs++;
+            img->format = format;
             img->width = frame->width;
             img->height = frame->height;
-            sws = sws_getCachedContext(sws, frame->width, frame->height, vcc->pix_fmt, frame->width, frame->height, PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+            if (format == VL_PIX_FMT_YUV420P) {
+              img->data = av_malloc(avpicture_get_size(AV_PIX_FMT_YUV420P, frame->width, frame->height) * sizeof(uint8_t));
+              avpicture_fill((AVPicture *)_frame, img->data, AV_PIX_FMT_YUV420P, frame->width, frame->height);
+              img->y = _frame->data[0];
+              img->u = _frame->data[1];
+              img->v = _frame->data[2];
+              sws = sws_getCachedContext(sws, frame->width, frame->height, frame->format, frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+            } else {
+              int bps = format == VL_PIX_FMT_P010 ? 2 : 1;
+              int luma = frame->width * frame->height * bps;
+              img->data = av_malloc((luma + (frame->width+1)/2 * (frame->height+1)/2 * 2 * bps) * sizeof(uint8_t));
+              img->y = img->data;
+              img->u = img->data + luma;
+              img->v = NULL;
+            }
           }
-          sws_scale(sws, (const uint8_t * const*)frame->data, frame->linesize, 0, frame->height, _frame->data, _frame->linesize);
+          start = VLTiming_now();
+          if (format == VL_PIX_FMT_YUV420P) {
+            sws_scale(sws, (const uint8_t * const*)frame->data, frame->linesize, 0, frame->height, _frame->data, _frame->linesize);
+          } else {
+            VLPlayer_copy(img, frame);
+          }
+          VLTiming_add(&(player->convert), VLTiming_now() - start);
+          img->seq++;
 
           img->pts = av_frame_get_best_effort_timestamp(frame);
           if (img->pts == AV_NOPTS_VALUE) {
@@ -161,18 +284,21 @@ static void *VLPlayer_thread(void *arg)
           }
           img->pts = (img->pts - ic->start_time) * av_q2d(vs->time_base) * 1000000;
           VLTimer_sync(timer, img->pts);
+          start = VLTiming_now();
         }
       }
-      av_free_packet(pkt);
+      av_packet_unref(pkt);
     } else {
       nanosleep(&TIMER_TEN_MILLI, NULL);
     }
   }
 
-  av_free(_frame);
-  av_free(frame);
+  av_frame_free(&_frame);
+  av_frame_free(&frame);
   sws_freeContext(sws);
-  avcodec_close(vcc);
+  avcodec_free_context(&vcc);
+  if (player->pool) VLPool_destroy(player->pool);
+  player->pool = NULL;
   avformat_close_input(&ic);
   avformat_network_deinit();
 
@@ -203,7 +329,7 @@ void VLPlayer_destroy(VLPlayer *player)
   player->timer->abort = true;
   pthread_join(player->thread, NULL);
   free(player->url);
-  free(player->image->data);
+  av_free(player->image->data);
   free(player->image);
   free(player->timer);
 
@@ -231,3 +357,8 @@ void VLPlayer_seek(VLPlayer *player, vl_time time)
 
   timer->seek = time;
 }
+
+vl_time VLPlayer_current(VLPlayer *player)
+{
+  return player->timer->current;
+}
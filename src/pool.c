@@ -0,0 +1,162 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
+#include "valo/pool.h"
+
+struct VLPool {
+  AVBufferPool *pool;
+  int size;
+};
+
+static uint64_t pool_served;
+static uint64_t pool_refills;
+static uint64_t pool_primed;
+static size_t pool_mapped_bytes;
+
+static size_t VLPool_mapped(int size)
+{
+  return ((size_t)size + VL_POOL_PAGE - 1) / VL_POOL_PAGE * VL_POOL_PAGE;
+}
+
+static void VLPool_unmap(void *opaque, uint8_t *data)
+{
+  size_t len = (size_t)(uintptr_t)opaque;
+  munmap(data, len);
+  __sync_fetch_and_sub(&pool_mapped_bytes, len);
+}
+
+/**
+ * Backing store for AVBufferPool: anonymous mappings rounded up to whole
+ * huge pages and aligned to a huge page boundary, so a 4K frame is a
+ * handful of TLB entries and never comes from the malloc arena. mmap only
+ * guarantees base page alignment, so one extra huge page is mapped and the
+ * slack on either side is given back. The pages are touched once after the
+ * huge page hint, so the first decode into a buffer doesn't fault.
+ */
+static AVBufferRef *VLPool_alloc(int size)
+{
+  size_t len = VLPool_mapped(size), head, page = sysconf(_SC_PAGESIZE);
+  AVBufferRef *buf;
+  uint8_t *map, *data;
+
+  map = mmap(NULL, len + VL_POOL_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "[OOM: %d] VLPool_alloc %zu\n", __LINE__, len);
+    return NULL;
+  }
+  data = (uint8_t *)(((uintptr_t)map + VL_POOL_PAGE - 1) & ~((uintptr_t)VL_POOL_PAGE - 1));
+  head = data - map;
+  if (head > 0) {
+    munmap(map, head);
+  }
+  munmap(data + len, VL_POOL_PAGE - head);
+#ifdef MADV_HUGEPAGE
+  madvise(data, len, MADV_HUGEPAGE);
+#endif
+  for (size_t off = 0; off < len; off += page) {
+    data[off] = 0;
+  }
+
+  buf = av_buffer_create(data, size, VLPool_unmap, (void *)(uintptr_t)len, 0);
+  if (buf == NULL) {
+    munmap(data, len);
+    return NULL;
+  }
+  __sync_fetch_and_add(&pool_refills, 1);
+  __sync_fetch_and_add(&pool_mapped_bytes, len);
+  return buf;
+}
+
+VLPool *VLPool_construct(int size, int capacity)
+{
+  VLPool *pool = NULL;
+  AVBufferRef *bufs[VL_POOL_FRAMES];
+
+  pool = calloc(1, sizeof(VLPool));
+  if (pool == NULL) {
+    fprintf(stderr, "[OOM: %d] VLPool_construct\n", __LINE__);
+    return NULL;
+  }
+
+  pool->size = size;
+  pool->pool = av_buffer_pool_init(size, VLPool_alloc);
+  if (pool->pool == NULL) {
+    free(pool);
+    return NULL;
+  }
+
+  if (capacity > VL_POOL_FRAMES) {
+    capacity = VL_POOL_FRAMES;
+  }
+  for (int i = 0; i < capacity; i++) {
+    bufs[i] = av_buffer_pool_get(pool->pool);
+  }
+  for (int i = 0; i < capacity; i++) {
+    if (bufs[i]) {
+      av_buffer_unref(&bufs[i]);
+      __sync_fetch_and_add(&pool_primed, 1);
+    }
+  }
+
+  return pool;
+}
+
+void VLPool_destroy(VLPool *pool)
+{
+  av_buffer_pool_uninit(&(pool->pool));
+  free(pool);
+}
+
+AVBufferRef *VLPool_get(VLPool *pool)
+{
+  __sync_fetch_and_add(&pool_served, 1);
+  return av_buffer_pool_get(pool->pool);
+}
+
+int VLPool_size(VLPool *pool)
+{
+  return pool->size;
+}
+
+void VLPool_stats(VLPoolStats *stats)
+{
+  stats->served = pool_served;
+  stats->refills = pool_refills;
+  stats->overflow = pool_refills - pool_primed;
+  stats->mapped_bytes = pool_mapped_bytes;
+}
@@ -0,0 +1,104 @@
+/**
+ * Valo - a panoramic image and video viewer
+ *
+ * Copyright (C) 2013 Cedric Fung <cedric@vec.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *    3. Neither the name of the Cedric Fung nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+
+ * THIS SOFTWARE IS PROVIDED BY Cedric Fung "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Cedric Fung BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "valo/stats.h"
+
+static const double TIMING_SMOOTH = 1.0 / 16;
+
+void VLHistogram_add(VLHistogram *h, double ms)
+{
+  int bin = ms < 0 ? 0 : ms / VL_HISTOGRAM_STEP;
+  if (bin > VL_HISTOGRAM_BINS) {
+    bin = VL_HISTOGRAM_BINS;
+  }
+
+  h->bins[bin]++;
+  h->count++;
+  h->sum += ms;
+  if (ms > h->max) {
+    h->max = ms;
+  }
+}
+
+double VLHistogram_mean(const VLHistogram *h)
+{
+  return h->count ? h->sum / h->count : 0;
+}
+
+double VLHistogram_percentile(const VLHistogram *h, double p)
+{
+  uint64_t rank = p * h->count, seen = 0;
+
+  for (int i = 0; i <= VL_HISTOGRAM_BINS; i++) {
+    seen += h->bins[i];
+    if (seen > rank) {
+      return i < VL_HISTOGRAM_BINS ? (i + 1) * VL_HISTOGRAM_STEP : h->max;
+    }
+  }
+  return h->max;
+}
+
+void VLHistogram_print(const VLHistogram *h, FILE *fp)
+{
+  fprintf(fp, "%s: n=%llu mean=%.2fms p50=%.1fms p90=%.1fms p99=%.1fms max=%.2fms\n", h->name,
+      (unsigned long long)h->count, VLHistogram_mean(h), VLHistogram_percentile(h, 0.5),
+      VLHistogram_percentile(h, 0.9), VLHistogram_percentile(h, 0.99), h->max);
+
+  for (int i = 0; i <= VL_HISTOGRAM_BINS; i++) {
+    if (h->bins[i] == 0) {
+      continue;
+    }
+    if (i < VL_HISTOGRAM_BINS) {
+      fprintf(fp, "  %6.1f-%6.1fms %llu\n", i * VL_HISTOGRAM_STEP, (i + 1) * VL_HISTOGRAM_STEP, (unsigned long long)h->bins[i]);
+    } else {
+      fprintf(fp, "  %6.1fms+       %llu\n", i * VL_HISTOGRAM_STEP, (unsigned long long)h->bins[i]);
+    }
+  }
+}
+
+double VLTiming_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void VLTiming_add(VLTiming *t, double ms)
+{
+  t->avg = t->last == 0 && t->avg == 0 ? ms : t->avg + (ms - t->avg) * TIMING_SMOOTH;
+  t->last = ms;
+  if (ms > t->max) {
+    t->max = ms;
+  }
+}
@@ -32,6 +32,8 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <math.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
@@ -39,6 +41,7 @@
 #include "3dm/poly.h"
 #include "valo/vlgl.h"
 #include "valo/player.h"
+#include "valo/stats.h"
 
 #define VLGL_CHECK_ERROR() do { \
   for (GLenum err = glGetError(); err != GL_NO_ERROR; err = glGetError()) { \
@@ -65,16 +68,34 @@ uniform mat4 u_model; \
 uniform mat4 u_view; \
 uniform mat4 u_proj; \
 uniform mat4 u_tex; \
+uniform vec4 u_eye[2]; \
+uniform vec4 u_out[2]; \
+uniform int u_projection; \
 layout(location=7) in vec4 a_position; \
 layout(location=3) in vec4 a_texcoord; \
 smooth out vec2 v_texcoord; \
+flat out int v_eye; \
+out float gl_ClipDistance[4]; \
 vec4 stereo(vec4 v) { \
   float len = length(v.xyz); \
   return vec4(v.x / (len - v.z), v.y / (len - v.z), 0, v.w); \
 } \
+vec4 rectilinear(vec4 v) { \
+  return vec4(v.x, v.y, 0, -2 * v.z); \
+} \
 void main() { \
-  v_texcoord = (u_tex * a_texcoord).xy; \
-  gl_Position = u_proj * u_view * stereo(u_model * a_position); \
+  vec4 o = u_out[gl_InstanceID]; \
+  vec4 v = u_model * a_position; \
+  vec4 p = u_proj * u_view * (u_projection == 1 ? rectilinear(v) : stereo(v)); \
+  p.xy = p.xy * o.xy + o.zw * p.w; \
+  p.z = (p.z + p.w) * 0.5 - float(gl_InstanceID) * p.w; \
+  gl_ClipDistance[0] = (o.z + o.x) * p.w - p.x; \
+  gl_ClipDistance[1] = p.x - (o.z - o.x) * p.w; \
+  gl_ClipDistance[2] = (o.w + o.y) * p.w - p.y; \
+  gl_ClipDistance[3] = p.y - (o.w - o.y) * p.w; \
+  v_texcoord = (u_tex * a_texcoord).xy * u_eye[gl_InstanceID].xy + u_eye[gl_InstanceID].zw; \
+  v_eye = gl_InstanceID; \
+  gl_Position = p; \
 } \
 "
 
@@ -83,18 +104,45 @@ void main() { \
 uniform sampler2D tex_y; \
 uniform sampler2D tex_u; \
 uniform sampler2D tex_v; \
+uniform int u_format; \
+uniform vec3 u_mask[2]; \
 smooth in vec2 v_texcoord; \
+flat in int v_eye; \
 smooth out vec4 color; \
 void main() { \
   vec3 yuv, rgb; \
   yuv.x = texture2D(tex_y, v_texcoord).x; \
-  yuv.y = texture2D(tex_u, v_texcoord).x - 0.5; \
-  yuv.z = texture2D(tex_v, v_texcoord).x - 0.5; \
+  if (u_format == 0) { \
+    yuv.y = texture2D(tex_u, v_texcoord).x - 0.5; \
+    yuv.z = texture2D(tex_v, v_texcoord).x - 0.5; \
+  } else { \
+    yuv.yz = texture2D(tex_u, v_texcoord).xy - 0.5; \
+  } \
   rgb = mat3(1,1,1,0,-.34413,1.772,1.402,-.71414,0) * yuv; \
-  color = vec4(rgb, 1.0); \
+  color = vec4(rgb * u_mask[v_eye], 1.0); \
 } \
 "
 
+static const GLfloat VLGL_EYE[][2][4] = {
+  [VLGL_STEREO_MONO] = { { 1, 1, 0, 0 }, { 1, 1, 0, 0 } },
+  [VLGL_STEREO_TB] = { { 1, 0.5, 0, 0 }, { 1, 0.5, 0, 0.5 } },
+  [VLGL_STEREO_SBS] = { { 0.5, 1, 0, 0 }, { 0.5, 1, 0.5, 0 } },
+};
+
+static const GLfloat VLGL_OUT[][2][4] = {
+  [VLGL_OUTPUT_MONO] = { { 1, 1, 0, 0 }, { 1, 1, 0, 0 } },
+  [VLGL_OUTPUT_ANAGLYPH] = { { 1, 1, 0, 0 }, { 1, 1, 0, 0 } },
+  [VLGL_OUTPUT_SBS] = { { 0.5, 1, -0.5, 0 }, { 0.5, 1, 0.5, 0 } },
+  [VLGL_OUTPUT_TB] = { { 1, 0.5, 0, 0.5 }, { 1, 0.5, 0, -0.5 } },
+};
+
+static const GLfloat VLGL_MASK[][2][3] = {
+  [VLGL_OUTPUT_MONO] = { { 1, 1, 1 }, { 1, 1, 1 } },
+  [VLGL_OUTPUT_ANAGLYPH] = { { 1, 0, 0 }, { 0, 1, 1 } },
+  [VLGL_OUTPUT_SBS] = { { 1, 1, 1 }, { 1, 1, 1 } },
+  [VLGL_OUTPUT_TB] = { { 1, 1, 1 }, { 1, 1, 1 } },
+};
+
 static GLuint VLGL_create_shader(GLuint type, const char *source)
 {
   GLuint shader = glCreateShader(type);
@@ -118,6 +166,197 @@ static GLuint VLGL_create_program(GLuint vert, GLuint frag)
   return prog;
 }
 
+static GLsizei VLGL_eyes(VLGL *gl)
+{
+  return gl->stereo != VLGL_STEREO_MONO && gl->output != VLGL_OUTPUT_MONO ? 2 : 1;
+}
+
+/**
+ * Both projections map the view center at the same scale: a point at angle
+ * phi from it lands at tan(k * phi) / (2 * k) on screen, with k = 1/2 for
+ * stereographic and k = 1 for rectilinear.
+ */
+static double VLGL_k(enum vlgl_projection projection)
+{
+  return projection == VLGL_PROJECTION_RECTILINEAR ? 1 : 0.5;
+}
+
+static double VLGL_angle(enum vlgl_projection projection, double r)
+{
+  double k = VLGL_k(projection);
+  return atan(2 * k * r) / k;
+}
+
+static double VLGL_stretch(enum vlgl_projection projection, double angle)
+{
+  return 1 / (2 * pow(cos(VLGL_k(projection) * angle), 2));
+}
+
+static void VLGL_project(VLGL *gl)
+{
+  GLfloat eye = 1;
+  if (VLGL_eyes(gl) > 1) {
+    eye = VLGL_OUT[gl->output][0][0] / VLGL_OUT[gl->output][0][1];
+  }
+
+  for (int i = 0; i < gl->n_views; i++) {
+    VLView *view = &(gl->views[i]);
+    GLfloat aspect = (gl->vw * view->w) / (gl->vh * view->h) * eye;
+    view->m_proj = mat4d_ortho(45 * gl->vz * view->fov, aspect, 1, 10);
+  }
+
+  if (gl->n_views > 1) {
+    double hfov[VLGL_VIEWS_MAX], total = 0, left;
+    for (int i = 0; i < gl->n_views; i++) {
+      mat4f proj = mat4d_to_mat4f(gl->views[i].m_proj);
+      hfov[i] = 2 * VLGL_angle(gl->views[i].projection, 1 / fabs(proj.ptr[0])) * 180 / M_PI;
+      total += hfov[i];
+    }
+    left = -total / 2;
+    for (int i = 0; i < gl->n_views; i++) {
+      if (gl->views[i].auto_yaw) {
+        gl->views[i].yaw = left + hfov[i] / 2;
+      }
+      left += hfov[i];
+    }
+  }
+}
+
+static int VLGL_bin(const double *c)
+{
+  int axis = 0;
+  for (int i = 1; i < 3; i++) {
+    if (fabs(c[i]) > fabs(c[axis])) axis = i;
+  }
+
+  double a = fabs(c[axis]);
+  int iu = (c[(axis+1)%3] / a + 1) / 2 * VLGL_BIN_GRID;
+  int iv = (c[(axis+2)%3] / a + 1) / 2 * VLGL_BIN_GRID;
+  if (iu >= VLGL_BIN_GRID) iu = VLGL_BIN_GRID - 1;
+  if (iv >= VLGL_BIN_GRID) iv = VLGL_BIN_GRID - 1;
+  return ((axis * 2 + (c[axis] < 0)) * VLGL_BIN_GRID + iu) * VLGL_BIN_GRID + iv;
+}
+
+static void VLGL_normalize(double *v)
+{
+  double len = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+  if (len > 0) {
+    v[0] /= len; v[1] /= len; v[2] /= len;
+  }
+}
+
+/**
+ * Triangles are sorted into VLGL_BINS buckets by the direction of their
+ * centroid, so that every bucket is a contiguous range of the index buffer
+ * and can be drawn, or skipped, on its own.
+ */
+static int VLGL_mesh_create(VLGL *gl, VLMesh *mesh, enum poly_type type, int precision)
+{
+  poly_t *poly = poly_create(type, precision);
+  size_t tris = poly->i_len / 3;
+  unsigned char *bins = malloc(tris * sizeof(unsigned char));
+  GLuint *indices = malloc(poly->i_len * sizeof(GLuint));
+  double (*dirs)[3] = calloc(VLGL_BINS, sizeof(*dirs));
+  double *cosr = malloc(VLGL_BINS * sizeof(double));
+  GLsizei fill[VLGL_BINS];
+  double min_dot = 1;
+
+  if (bins == NULL || indices == NULL || dirs == NULL || cosr == NULL) {
+    fprintf(stderr, "[OOM: %d] VLGL_mesh_create\n", __LINE__);
+    free(bins); free(indices); free(dirs); free(cosr);
+    poly_destroy(poly);
+    return -1;
+  }
+
+  mesh->precision = precision;
+  mesh->i_len = poly->i_len;
+  for (int b = 0; b < VLGL_BINS; b++) {
+    mesh->bin_count[b] = 0;
+    cosr[b] = 1;
+  }
+
+  for (size_t t = 0; t < tris; t++) {
+    double v[3][3], c[3] = { 0, 0, 0 };
+    for (int k = 0; k < 3; k++) {
+      const float *p = poly->vertices + 3 * poly->indices[3 * t + k];
+      v[k][0] = p[0]; v[k][1] = p[1]; v[k][2] = p[2];
+      VLGL_normalize(v[k]);
+      c[0] += v[k][0]; c[1] += v[k][1]; c[2] += v[k][2];
+    }
+    for (int k = 0; k < 3; k++) {
+      const double *a = v[k], *b = v[(k+1)%3];
+      double dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+      if (dot < min_dot) min_dot = dot;
+    }
+    VLGL_normalize(c);
+    bins[t] = VLGL_bin(c);
+    mesh->bin_count[bins[t]] += 3;
+    dirs[bins[t]][0] += c[0]; dirs[bins[t]][1] += c[1]; dirs[bins[t]][2] += c[2];
+  }
+
+  for (int b = 0, first = 0; b < VLGL_BINS; b++) {
+    mesh->bin_first[b] = fill[b] = first;
+    first += mesh->bin_count[b];
+    VLGL_normalize(dirs[b]);
+  }
+
+  for (size_t t = 0; t < tris; t++) {
+    const double *d = dirs[bins[t]];
+    for (int k = 0; k < 3; k++) {
+      GLuint i = poly->indices[3 * t + k];
+      double v[3] = { poly->vertices[3*i], poly->vertices[3*i+1], poly->vertices[3*i+2] };
+      VLGL_normalize(v);
+      double dot = v[0]*d[0] + v[1]*d[1] + v[2]*d[2];
+      if (dot < cosr[bins[t]]) cosr[bins[t]] = dot;
+      indices[fill[bins[t]]++] = i;
+    }
+  }
+
+  for (int b = 0; b < VLGL_BINS; b++) {
+    mesh->bin_dir[b][0] = dirs[b][0];
+    mesh->bin_dir[b][1] = dirs[b][1];
+    mesh->bin_dir[b][2] = dirs[b][2];
+    mesh->bin_radius[b] = acos(fmax(-1, fmin(1, cosr[b])));
+  }
+  mesh->edge = acos(fmax(-1, fmin(1, min_dot)));
+
+  glGenVertexArrays(1, &(mesh->vao));
+  glBindVertexArray(mesh->vao);
+  glGenBuffers(1, &(mesh->vbo));
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+  glBufferData(GL_ARRAY_BUFFER, poly->v_len * sizeof(float), poly->vertices, GL_STATIC_DRAW);
+  glVertexAttribPointer(gl->v_position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
+  glEnableVertexAttribArray(gl->v_position);
+  glGenBuffers(1, &(mesh->tbo));
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->tbo);
+  glBufferData(GL_ARRAY_BUFFER, poly->t_len * sizeof(float), poly->texcoords, GL_STATIC_DRAW);
+  glVertexAttribPointer(gl->v_texcoord, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
+  glEnableVertexAttribArray(gl->v_texcoord);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+
+  glGenBuffers(1, &(mesh->ebo));
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->i_len * sizeof(GLuint), indices, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  gl->mesh_bytes += (poly->v_len + poly->t_len) * sizeof(float) + mesh->i_len * sizeof(GLuint);
+
+  free(bins);
+  free(indices);
+  free(dirs);
+  free(cosr);
+  poly_destroy(poly);
+  return 0;
+}
+
+static void VLGL_mesh_destroy(VLMesh *mesh)
+{
+  glDeleteBuffers(1, &(mesh->tbo));
+  glDeleteBuffers(1, &(mesh->vbo));
+  glDeleteBuffers(1, &(mesh->ebo));
+  glDeleteVertexArrays(1, &(mesh->vao));
+}
+
 VLGL *VLGL_construct(enum poly_type type, int precision)
 {
   VLGL *gl = NULL;
@@ -128,13 +367,15 @@ VLGL *VLGL_construct(enum poly_type type, int precision)
     fprintf(stderr, "[OOM: %d] VLGL_construct\n", __LINE__);
     return NULL;
   }
-  gl->poly = poly_create(type, precision);
 
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
   glFrontFace(GL_CCW);
   glCullFace(GL_BACK);
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < 4; i++) {
+    glEnable(GL_CLIP_DISTANCE0 + i);
+  }
 
   vert = VLGL_create_shader(GL_VERTEX_SHADER, VLGL_VERT_ID);
   frag = VLGL_create_shader(GL_FRAGMENT_SHADER, VLGL_FRAG_YUV);
@@ -149,29 +390,22 @@ VLGL *VLGL_construct(enum poly_type type, int precision)
   gl->u_view = glGetUniformLocation(prog, "u_view");
   gl->u_proj = glGetUniformLocation(prog, "u_proj");
   gl->u_tex = glGetUniformLocation(prog, "u_tex");
+  gl->u_eye = glGetUniformLocation(prog, "u_eye");
+  gl->u_out = glGetUniformLocation(prog, "u_out");
+  gl->u_mask = glGetUniformLocation(prog, "u_mask");
+  gl->u_projection = glGetUniformLocation(prog, "u_projection");
+  gl->u_format = glGetUniformLocation(prog, "u_format");
   gl->samplers[0] = glGetUniformLocation(prog, "tex_y");
   gl->samplers[1] = glGetUniformLocation(prog, "tex_u");
   gl->samplers[2] = glGetUniformLocation(prog, "tex_v");
 
-  glGenVertexArrays(1, &(gl->vao));
-  glBindVertexArray(gl->vao);
-  glGenBuffers(1, &(gl->vbo));
-  glBindBuffer(GL_ARRAY_BUFFER, gl->vbo);
-  glBufferData(GL_ARRAY_BUFFER, gl->poly->v_len * sizeof(float), gl->poly->vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(gl->v_position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), 0);
-  glEnableVertexAttribArray(gl->v_position);
-  glGenBuffers(1, &(gl->tbo));
-  glBindBuffer(GL_ARRAY_BUFFER, gl->tbo);
-  glBufferData(GL_ARRAY_BUFFER, gl->poly->t_len * sizeof(float), gl->poly->texcoords, GL_STATIC_DRAW);
-  glVertexAttribPointer(gl->v_texcoord, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
-  glEnableVertexAttribArray(gl->v_texcoord);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  for (int p = precision < VLGL_LOD_MAX ? 1 : precision - VLGL_LOD_MAX + 1; p <= precision; p++) {
+    if (VLGL_mesh_create(gl, &(gl->meshes[gl->n_meshes]), type, p) == 0) {
+      gl->n_meshes++;
+    }
+  }
 
-  glGenBuffers(1, &(gl->ebo));
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, gl->poly->i_len * sizeof(float), gl->poly->indices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glGenBuffers(1, &(gl->dbo));
 
   glGenTextures(3, gl->textures);
   for (int i = 0; i < 3; i++) {
@@ -186,7 +420,7 @@ VLGL *VLGL_construct(enum poly_type type, int precision)
   gl->vw = 1; gl->vh = 1; gl->vz = 1;
   gl->rotate_v = -90;
   gl->m_model = mat4d_rotate(mat4d_identity(), (vec4d)vector_new(1, 0, 0), -90);
-  gl->m_proj = mat4d_ortho(45 * gl->vz, gl->vw / gl->vh, 1, 10);
+  VLGL_views(gl, 1);
   gl->m_view = mat4d_look_at((vec4d)vector_new(0, 0, -1), (vec4d)vector_new(0), (vec4d)vector_new(0,1,0));
   gl->m_tex = mat4d_identity();
 
@@ -196,50 +430,204 @@ VLGL *VLGL_construct(enum poly_type type, int precision)
 
 void VLGL_destroy(VLGL *gl)
 {
-  poly_destroy(gl->poly);
+  for (int i = 0; i < gl->n_meshes; i++) {
+    VLGL_mesh_destroy(&(gl->meshes[i]));
+  }
+  glDeleteBuffers(1, &(gl->dbo));
   glDeleteTextures(3, gl->textures);
-  glDeleteBuffers(1, &(gl->tbo));
-  glDeleteBuffers(1, &(gl->vbo));
-  glDeleteBuffers(1, &(gl->ebo));
-  glDeleteVertexArrays(1, &(gl->vao));
   glDeleteProgram(gl->program);
   VLGL_CHECK_ERROR();
 
   free(gl);
 }
 
-void VLGL_render(VLGL *gl, VLImage *img)
+typedef struct VLDrawCommand {
+  GLuint count;
+  GLuint instances;
+  GLuint first;
+  GLint base_vertex;
+  GLuint base_instance;
+} VLDrawCommand;
+
+/**
+ * Runs of adjacent bins are merged and the whole selection goes out as one
+ * indirect multi-draw, with both stereo eyes as instances of every run.
+ */
+static void VLGL_draw_bins(VLGL *gl, VLMesh *mesh, const bool *visible, bool want, GLsizei instances)
 {
-  glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glUseProgram(gl->program);
+  VLDrawCommand cmds[VLGL_BINS];
+  GLsizei n = 0, end = -1;
 
-  if (img->y && img->u && img->v) {
-    glActiveTexture(GL_TEXTURE0 + 64);
-    glBindTexture(GL_TEXTURE_2D, gl->textures[0]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, img->width, img->height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->y);
-    glUniform1i(gl->samplers[0], 64);
+  for (int b = 0; b < VLGL_BINS; b++) {
+    if (visible[b] != want || mesh->bin_count[b] == 0) {
+      continue;
+    }
+    if (mesh->bin_first[b] == end) {
+      cmds[n-1].count += mesh->bin_count[b];
+    } else {
+      cmds[n].count = mesh->bin_count[b];
+      cmds[n].instances = instances;
+      cmds[n].first = mesh->bin_first[b];
+      cmds[n].base_vertex = 0;
+      cmds[n].base_instance = 0;
+      n++;
+    }
+    end = mesh->bin_first[b] + mesh->bin_count[b];
+  }
 
-    glActiveTexture(GL_TEXTURE0 + 65);
-    glBindTexture(GL_TEXTURE_2D, gl->textures[1]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, (img->width+1)/2, (img->height+1)/2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->u);
-    glUniform1i(gl->samplers[1], 65);
+  if (n > 0) {
+    glBindVertexArray(mesh->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ebo);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gl->dbo);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, n * sizeof(VLDrawCommand), cmds, GL_STREAM_DRAW);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, n, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+}
 
+/**
+ * Pick the coarsest mesh whose faceting stays under VLGL_LOD_ERROR pixels
+ * at the most stretched visible point of the view's projection, and draw it
+ * only over the bins that can reach the screen. Bins outside the view keep
+ * the coarsest mesh, so nothing is lost if the estimate is off. The fine
+ * mesh goes first so the depth test rejects coarse triangles overlapping
+ * it. Both eyes of a stereo frame are drawn as two instances of the same
+ * pass, each in its own half of the depth range, so anaglyph eyes still
+ * add up where they overlap.
+ */
+static void VLGL_draw(VLGL *gl, VLView *view, mat4d m_model)
+{
+  mat4f model = mat4d_to_mat4f(m_model);
+  mat4f proj = mat4d_to_mat4f(view->m_proj);
+  GLsizei instances = VLGL_eyes(gl);
+  GLfloat eye_h = gl->vh * view->h * (instances > 1 ? VLGL_OUT[gl->output][0][1] : 1);
+  double dir[3] = { -model.ptr[8], -model.ptr[9], -model.ptr[10] };
+  double right = 1 / fabs(proj.ptr[0]), top = 1 / fabs(proj.ptr[5]);
+  double fov = VLGL_angle(view->projection, sqrt(right * right + top * top));
+  double scale = eye_h / (2 * top) * VLGL_stretch(view->projection, fov);
+  bool visible[VLGL_BINS];
+  VLMesh *coarse, *fine;
+
+  if (gl->n_meshes == 0) {
+    return;
+  }
+
+  view->lod = gl->n_meshes - 1;
+  for (int i = 0; i < gl->n_meshes; i++) {
+    double edge = gl->meshes[i].edge;
+    if (edge * edge / 8 * scale < VLGL_LOD_ERROR) {
+      view->lod = i;
+      break;
+    }
+  }
+
+  coarse = &(gl->meshes[0]);
+  fine = &(gl->meshes[view->lod]);
+  VLGL_normalize(dir);
+  for (int b = 0; b < VLGL_BINS; b++) {
+    const GLfloat *d = fine->bin_dir[b];
+    double angle = acos(fmax(-1, fmin(1, d[0]*dir[0] + d[1]*dir[1] + d[2]*dir[2])));
+    visible[b] = angle - fine->bin_radius[b] < fov;
+  }
+
+  VLGL_draw_bins(gl, fine, visible, true, instances);
+  if (fine != coarse) {
+    VLGL_draw_bins(gl, coarse, visible, false, instances);
+  }
+}
+
+void VLGL_upload(VLGL *gl, VLImage *img)
+{
+  int cw = (img->width+1)/2, ch = (img->height+1)/2;
+  int bps = img->format == VL_PIX_FMT_P010 ? 2 : 1;
+  double start = VLTiming_now();
+
+  if (img->y == NULL || img->u == NULL || (img->format == VL_PIX_FMT_YUV420P && img->v == NULL)) {
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + 64);
+  glBindTexture(GL_TEXTURE_2D, gl->textures[0]);
+  switch (img->format) {
+    case VL_PIX_FMT_YUV420P:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, img->width, img->height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->y);
+      break;
+    case VL_PIX_FMT_NV12:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, img->width, img->height, 0, GL_RED, GL_UNSIGNED_BYTE, img->y);
+      break;
+    case VL_PIX_FMT_P010:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R16, img->width, img->height, 0, GL_RED, GL_UNSIGNED_SHORT, img->y);
+      break;
+  }
+
+  glActiveTexture(GL_TEXTURE0 + 65);
+  glBindTexture(GL_TEXTURE_2D, gl->textures[1]);
+  switch (img->format) {
+    case VL_PIX_FMT_YUV420P:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, cw, ch, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->u);
+      break;
+    case VL_PIX_FMT_NV12:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, cw, ch, 0, GL_RG, GL_UNSIGNED_BYTE, img->u);
+      break;
+    case VL_PIX_FMT_P010:
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, cw, ch, 0, GL_RG, GL_UNSIGNED_SHORT, img->u);
+      break;
+  }
+
+  if (img->format == VL_PIX_FMT_YUV420P) {
     glActiveTexture(GL_TEXTURE0 + 66);
     glBindTexture(GL_TEXTURE_2D, gl->textures[2]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, (img->width+1)/2, (img->height+1)/2, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->v);
-    glUniform1i(gl->samplers[2], 66);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, cw, ch, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, img->v);
   }
+  gl->format = img->format;
+
+  gl->texture_bytes = ((size_t)img->width * img->height + (size_t)cw * ch * 2) * bps;
+  VLTiming_add(&(gl->upload), VLTiming_now() - start);
+}
+
+void VLGL_render(VLGL *gl, VLImage *img)
+{
+  bool anaglyph = VLGL_eyes(gl) > 1 && gl->output == VLGL_OUTPUT_ANAGLYPH;
+
+  if (anaglyph) {
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+  } else {
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+  }
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glUseProgram(gl->program);
 
-  glUniformMatrix4fv(gl->u_model, 1, GL_TRUE, mat4d_to_mat4f(gl->m_model).ptr);
+  VLGL_upload(gl, img);
+
+  for (int i = 0; i < 3; i++) {
+    glUniform1i(gl->samplers[i], 64 + i);
+  }
+  glUniform1i(gl->u_format, gl->format);
   glUniformMatrix4fv(gl->u_view, 1, GL_TRUE, mat4d_to_mat4f(gl->m_view).ptr);
-  glUniformMatrix4fv(gl->u_proj, 1, GL_TRUE, mat4d_to_mat4f(gl->m_proj).ptr);
   glUniformMatrix4fv(gl->u_tex, 1, GL_TRUE, mat4d_to_mat4f(gl->m_tex).ptr);
+  glUniform4fv(gl->u_eye, 2, &VLGL_EYE[gl->stereo][0][0]);
+  glUniform4fv(gl->u_out, 2, &VLGL_OUT[VLGL_eyes(gl) > 1 ? gl->output : VLGL_OUTPUT_MONO][0][0]);
+  glUniform3fv(gl->u_mask, 2, &VLGL_MASK[VLGL_eyes(gl) > 1 ? gl->output : VLGL_OUTPUT_MONO][0][0]);
+
+  for (int i = 0; i < gl->n_views; i++) {
+    VLView *view = &(gl->views[i]);
+    mat4d model = gl->m_model;
+    if (view->yaw != 0) {
+      model = mat4d_rotate(model, (vec4d)vector_new(0, 1, 0), view->yaw);
+    }
+    glViewport(view->x * gl->vw, view->y * gl->vh, view->w * gl->vw, view->h * gl->vh);
+    glUniformMatrix4fv(gl->u_model, 1, GL_TRUE, mat4d_to_mat4f(model).ptr);
+    glUniformMatrix4fv(gl->u_proj, 1, GL_TRUE, mat4d_to_mat4f(view->m_proj).ptr);
+    glUniform1i(gl->u_projection, view->projection);
+    VLGL_draw(gl, view, model);
+  }
+  glViewport(0, 0, gl->vw, gl->vh);
 
-  glBindVertexArray(gl->vao);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl->ebo);
-
-  glDrawElements(GL_TRIANGLES, gl->poly->i_len, GL_UNSIGNED_INT, 0);
+  if (anaglyph) {
+    glDisable(GL_BLEND);
+  }
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
@@ -252,7 +640,7 @@ void VLGL_render(VLGL *gl, VLImage *img)
 void VLGL_viewport(VLGL *gl, int w, int h)
 {
   gl->vw = w; gl->vh = h;
-  gl->m_proj = mat4d_ortho(45 * gl->vz, gl->vw / gl->vh, 1, 10);
+  VLGL_project(gl);
 }
 
 void VLGL_rotate(VLGL *gl, double x, double y, double z, double degree)
@@ -280,7 +668,7 @@ void VLGL_zoom(VLGL *gl, double inc)
   } else if (gl->vz < 0.1) {
     gl->vz = 0.1;
   }
-  gl->m_proj = mat4d_ortho(45 * gl->vz, gl->vw / gl->vh, 1, 10);
+  VLGL_project(gl);
 }
 
 void VLGL_reset(VLGL *gl)
@@ -288,7 +676,64 @@ void VLGL_reset(VLGL *gl)
   gl->vz = 1;
   gl->rotate_v = -90;
   gl->m_model = mat4d_rotate(mat4d_identity(), (vec4d)vector_new(1, 0, 0), -90);
-  gl->m_proj = mat4d_ortho(45 * gl->vz, gl->vw / gl->vh, 1, 10);
+  VLGL_project(gl);
+}
+
+void VLGL_stereo(VLGL *gl, enum vlgl_stereo stereo, enum vlgl_output output)
+{
+  gl->stereo = stereo;
+  gl->output = output;
+  VLGL_project(gl);
+}
+
+void VLGL_views(VLGL *gl, int n)
+{
+  enum vlgl_projection projection = gl->n_views > 0 ? gl->views[0].projection : VLGL_PROJECTION_STEREO;
+
+  if (n < 1) {
+    n = 1;
+  } else if (n > VLGL_VIEWS_MAX) {
+    n = VLGL_VIEWS_MAX;
+  }
+
+  gl->n_views = n;
+  for (int i = 0; i < n; i++) {
+    VLView *view = &(gl->views[i]);
+    view->x = (GLfloat)i / n;
+    view->y = 0;
+    view->w = 1.0f / n;
+    view->h = 1;
+    view->yaw = 0;
+    view->auto_yaw = true;
+    view->fov = 1;
+    view->projection = projection;
+    view->lod = 0;
+  }
+  VLGL_project(gl);
+}
+
+void VLGL_view(VLGL *gl, int i, GLfloat yaw, GLfloat fov, enum vlgl_projection projection)
+{
+  VLView *view;
+
+  if (i < 0 || i >= gl->n_views) {
+    return;
+  }
+
+  view = &(gl->views[i]);
+  view->auto_yaw = isnan(yaw);
+  view->yaw = view->auto_yaw ? 0 : yaw;
+  view->fov = fov > 0 ? fov : 1;
+  view->projection = projection;
+  VLGL_project(gl);
+}
+
+void VLGL_projection(VLGL *gl, enum vlgl_projection projection)
+{
+  for (int i = 0; i < gl->n_views; i++) {
+    gl->views[i].projection = projection;
+  }
+  VLGL_project(gl);
 }
 
 void VLGL_version(void)
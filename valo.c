@@ -27,36 +27,102 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define GL_GLEXT_PROTOTYPES
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <GLFW/glfw3.h>
 #include "valo/vlgl.h"
 #include "valo/player.h"
+#include "valo/stats.h"
+#include "valo/control.h"
+#include "valo/pool.h"
+
+#define VL_FRAMES_MAX 8
 
 static const vl_time TIMER_SEEK_STEP = 1e7;
+static const double INPUT_ROTATE_SPEED = 90;
+static const double INPUT_DRAG_SPEED = 0.25;
+static const GLuint64 FENCE_TIMEOUT = 1e9;
+static const double TELEMETRY_MS = 250;
+
+typedef struct VLInput {
+  bool left, right, up, down;
+  bool drag;
+  double cursor_x, cursor_y;
+  double drag_x, drag_y;
+  double turn;
+  double zoom;
+  double since;
+} VLInput;
+
+typedef struct VLFrame {
+  GLsync fence;
+  GLuint query;
+  double input;
+} VLFrame;
+
+typedef struct VLApp {
+  VLPlayer *player;
+  VLInput input;
+  VLFrame frames[VL_FRAMES_MAX];
+  int head, n_frames;
+  VLHistogram latency;
+  VLControl *control;
+  uint64_t last_seq;
+  uint64_t presented, dropped;
+  uint64_t commands, errors;
+  VLTiming render, swap;
+  double published;
+} VLApp;
+
+static void input_touch(VLInput *input)
+{
+  if (input->since == 0) {
+    input->since = glfwGetTime();
+  }
+}
 
 #define VL_GLFW_CB
 VL_GLFW_CB static void key_cb(GLFWwindow *window, int key, int scancode, int action, int modes)
 {
-  VLPlayer *player = glfwGetWindowUserPointer(window);
-  if (action == GLFW_PRESS) {
+  VLApp *app = glfwGetWindowUserPointer(window);
+  VLPlayer *player = app->player;
+  VLInput *input = &(app->input);
+
+  if (action != GLFW_REPEAT) {
+    bool held = action == GLFW_PRESS;
     switch (key) {
-      case GLFW_KEY_SPACE:
-        VLPlayer_pause(player);
-        VLGL_reset(player->gl);
-        break;
       case GLFW_KEY_LEFT:
-        VLGL_rotate(player->gl, 0, 1, 0, -10);
+        input->left = held;
         break;
       case GLFW_KEY_RIGHT:
-        VLGL_rotate(player->gl, 0, 1, 0, 10);
+        input->right = held;
         break;
       case GLFW_KEY_UP:
-        VLGL_rotate(player->gl, 1, 0, 0, -10);
+        input->up = held;
         break;
       case GLFW_KEY_DOWN:
-        VLGL_rotate(player->gl, 1, 0, 0, 10);
+        input->down = held;
+        break;
+      default:
+        break;
+    }
+    if (held) {
+      input_touch(input);
+    }
+  }
+
+  if (action == GLFW_PRESS) {
+    switch (key) {
+      case GLFW_KEY_SPACE:
+        VLPlayer_pause(player);
+        VLGL_reset(player->gl);
         break;
       case GLFW_KEY_B:
         VLPlayer_seek(player, -TIMER_SEEK_STEP);
@@ -65,10 +131,16 @@ VL_GLFW_CB static void key_cb(GLFWwindow *window, int key, int scancode, int act
         VLPlayer_seek(player, TIMER_SEEK_STEP);
         break;
       case GLFW_KEY_I:
-        VLGL_zoom(player->gl, 0.1);
+        input->zoom += 0.1;
         break;
       case GLFW_KEY_O:
-        VLGL_zoom(player->gl, -0.1);
+        input->zoom -= 0.1;
+        break;
+      case GLFW_KEY_P:
+        VLGL_projection(player->gl, !player->gl->views[0].projection);
+        break;
+      case GLFW_KEY_S:
+        VLGL_stereo(player->gl, player->gl->stereo, (player->gl->output + 1) % (VLGL_OUTPUT_TB + 1));
         break;
       case GLFW_KEY_ESCAPE:
         glfwSetWindowShouldClose(window, GL_TRUE);
@@ -80,19 +152,41 @@ VL_GLFW_CB static void key_cb(GLFWwindow *window, int key, int scancode, int act
 
 VL_GLFW_CB static void scroll_cb(GLFWwindow *window, double x, double y)
 {
-  VLPlayer *player = glfwGetWindowUserPointer(window);
+  VLApp *app = glfwGetWindowUserPointer(window);
   if (y !=  0) {
-    VLGL_zoom(player->gl, y / 10);
+    app->input.zoom += y / 10;
   } else if (x != 0) {
-    VLGL_rotate(player->gl, 0, 1, 0, 10 * x);
+    app->input.turn += 10 * x;
   }
+  input_touch(&(app->input));
+}
+
+VL_GLFW_CB static void mouse_button_cb(GLFWwindow *window, int button, int action, int modes)
+{
+  VLApp *app = glfwGetWindowUserPointer(window);
+  if (button == GLFW_MOUSE_BUTTON_LEFT) {
+    app->input.drag = action == GLFW_PRESS;
+  }
+}
+
+VL_GLFW_CB static void cursor_pos_cb(GLFWwindow *window, double x, double y)
+{
+  VLApp *app = glfwGetWindowUserPointer(window);
+  VLInput *input = &(app->input);
+  if (input->drag) {
+    input->drag_x += x - input->cursor_x;
+    input->drag_y += y - input->cursor_y;
+    input_touch(input);
+  }
+  input->cursor_x = x;
+  input->cursor_y = y;
 }
 
 VL_GLFW_CB static void framebuffer_size_cb(GLFWwindow *window, int w, int h)
 {
-  VLPlayer *player = glfwGetWindowUserPointer(window);
+  VLApp *app = glfwGetWindowUserPointer(window);
   glViewport(0, 0, w, h);
-  VLGL_viewport(player->gl, w, h);
+  VLGL_viewport(app->player->gl, w, h);
 }
 
 VL_GLFW_CB static void error_cb(int error, const char* description)
@@ -100,6 +194,211 @@ VL_GLFW_CB static void error_cb(int error, const char* description)
   fprintf(stderr, "%d, %s\n", error, description);
 }
 
+/**
+ * Apply everything the callbacks queued since the last frame, right before
+ * it is drawn. Held keys turn the view continuously, scaled by the frame
+ * time. Returns when the oldest queued input arrived, or 0 for none.
+ */
+static double latch_input(VLApp *app, double now, double dt)
+{
+  VLInput *input = &(app->input);
+  VLGL *gl = app->player->gl;
+  double since = input->since;
+  double yaw = input->turn - input->drag_x * INPUT_DRAG_SPEED * gl->vz;
+  double pitch = -input->drag_y * INPUT_DRAG_SPEED * gl->vz;
+
+  if (dt > 0.1) {
+    dt = 0.1;
+  }
+  if (input->left || input->right || input->up || input->down) {
+    yaw += (input->right - input->left) * INPUT_ROTATE_SPEED * dt;
+    pitch += (input->down - input->up) * INPUT_ROTATE_SPEED * dt;
+    if (since == 0) {
+      since = now;
+    }
+  }
+
+  if (yaw != 0) {
+    VLGL_rotate(gl, 0, 1, 0, yaw);
+  }
+  if (pitch != 0) {
+    VLGL_rotate(gl, 1, 0, 0, pitch);
+  }
+  if (input->zoom != 0) {
+    VLGL_zoom(gl, input->zoom);
+  }
+
+  input->turn = input->zoom = 0;
+  input->drag_x = input->drag_y = 0;
+  input->since = 0;
+  return since;
+}
+
+/**
+ * Convert a GL_TIMESTAMP value to glfwGetTime() seconds by sampling both
+ * clocks now.
+ */
+static double gpu_to_cpu_time(GLuint64 gpu)
+{
+  GLint64 gpu_now;
+  glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+  return glfwGetTime() - ((double)gpu_now - (double)gpu) / 1e9;
+}
+
+/**
+ * Retire presented frames until at most `keep` are still in flight on the
+ * GPU, recording input-to-GPU-completion latency for those that carried
+ * input. The completion time comes from the timestamp query issued next to
+ * the fence, so it doesn't include how late the fence was polled. Scanout
+ * happens later still and isn't measured.
+ */
+static void retire_frames(VLApp *app, int keep)
+{
+  while (app->n_frames > 0) {
+    VLFrame *frame = &(app->frames[app->head]);
+    GLuint64 timeout = app->n_frames > keep ? FENCE_TIMEOUT : 0;
+    GLenum ret = glClientWaitSync(frame->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    if (ret == GL_TIMEOUT_EXPIRED && app->n_frames <= keep) {
+      break;
+    }
+    if (frame->input > 0 && (ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED)) {
+      GLuint64 done;
+      glGetQueryObjectui64v(frame->query, GL_QUERY_RESULT, &done);
+      VLHistogram_add(&(app->latency), (gpu_to_cpu_time(done) - frame->input) * 1000);
+    }
+    glDeleteSync(frame->fence);
+    app->head = (app->head + 1) % VL_FRAMES_MAX;
+    app->n_frames--;
+  }
+}
+
+static void present_frame(VLApp *app, GLFWwindow *window, double input)
+{
+  VLFrame *frame = &(app->frames[(app->head + app->n_frames) % VL_FRAMES_MAX]);
+  double start = VLTiming_now();
+  glfwSwapBuffers(window);
+  VLTiming_add(&(app->swap), VLTiming_now() - start);
+  glQueryCounter(frame->query, GL_TIMESTAMP);
+  frame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  frame->input = input;
+  app->n_frames++;
+}
+
+/**
+ * Stopping a player joins its decoder thread, which may be blocked in I/O,
+ * so a replaced player is torn down off the render thread.
+ */
+static void *reap_player(void *player)
+{
+  VLPlayer_destroy(player);
+  return NULL;
+}
+
+static int apply_command(VLApp *app, char *cmd)
+{
+  VLGL *gl = app->player->gl;
+  char name[16], *args, *end;
+  double a, b;
+  int n;
+
+  if (sscanf(cmd, " %15s%n", name, &n) != 1) {
+    return 0;
+  }
+  args = cmd + n;
+  while (*args == ' ') args++;
+  for (end = args + strlen(args); end > args && end[-1] == ' '; end--) *(end-1) = '\0';
+
+  if (!strcmp("seek", name) && sscanf(args, "%lf", &a) == 1) {
+    VLPlayer_seek(app->player, a * 1e6);
+  } else if (!strcmp("rotate", name) && sscanf(args, "%lf %lf", &a, &b) == 2) {
+    VLGL_rotate(gl, 0, 1, 0, a);
+    VLGL_rotate(gl, 1, 0, 0, b);
+  } else if (!strcmp("zoom", name) && sscanf(args, "%lf", &a) == 1) {
+    VLGL_zoom(gl, a);
+  } else if (!strcmp("projection", name) && !strcmp("stereo", args)) {
+    VLGL_projection(gl, VLGL_PROJECTION_STEREO);
+  } else if (!strcmp("projection", name) && !strcmp("rectilinear", args)) {
+    VLGL_projection(gl, VLGL_PROJECTION_RECTILINEAR);
+  } else if (!strcmp("pause", name)) {
+    VLPlayer_pause(app->player);
+  } else if (!strcmp("reset", name)) {
+    VLGL_reset(gl);
+  } else if (!strcmp("load", name) && args[0] != '\0') {
+    VLPlayer *old = app->player, *next = VLPlayer_construct(gl, args);
+    pthread_t reaper;
+    if (next == NULL) {
+      return -1;
+    }
+    app->player = next;
+    app->last_seq = 0;
+    if (pthread_create(&reaper, NULL, reap_player, old) == 0) {
+      pthread_detach(reaper);
+    } else {
+      VLPlayer_destroy(old);
+    }
+  } else {
+    fprintf(stderr, "[Control] invalid command: %s %s\n", name, args);
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * Commands in one batch are separated by ';' and take effect in the same
+ * frame, before its input is latched.
+ */
+static void apply_control(VLApp *app)
+{
+  char batch[VL_CONTROL_LINE], *save = NULL;
+
+  while (VLControl_poll(app->control, batch, sizeof(batch))) {
+    for (char *cmd = strtok_r(batch, ";", &save); cmd; cmd = strtok_r(NULL, ";", &save)) {
+      int ret = apply_command(app, cmd);
+      if (ret > 0) {
+        app->commands++;
+      } else if (ret < 0) {
+        app->errors++;
+      }
+    }
+  }
+}
+
+static void publish_telemetry(VLApp *app, double now)
+{
+  VLPlayer *player = app->player;
+  VLGL *gl = player->gl;
+  char buf[VL_CONTROL_LINE];
+  VLPoolStats pool;
+
+  VLPool_stats(&pool);
+  snprintf(buf, sizeof(buf), "{\"pts\":%.3f,\"decoded\":%llu,\"presented\":%llu,\"dropped\":%llu,\"queue\":%llu,"
+      "\"decode_ms\":%.3f,\"convert_ms\":%.3f,\"upload_ms\":%.3f,\"render_ms\":%.3f,\"swap_ms\":%.3f,"
+      "\"latency_p99_ms\":%.1f,\"lod\":%d,\"gpu_bytes\":%zu,\"commands\":%llu,\"errors\":%llu,"
+      "\"frames_served\":%llu,\"pool_refills\":%llu,\"pool_overflow\":%llu,\"pool_mapped_bytes\":%zu,\"image_reallocs\":%llu}",
+      VLPlayer_current(player) / 1e6, (unsigned long long)player->image->seq,
+      (unsigned long long)app->presented, (unsigned long long)app->dropped,
+      (unsigned long long)(player->image->seq - app->last_seq),
+      player->decode.avg, player->convert.avg, gl->upload.avg, app->render.avg, app->swap.avg,
+      VLHistogram_percentile(&(app->latency), 0.99), gl->meshes[gl->views[0].lod].precision,
+      gl->mesh_bytes + gl->texture_bytes, (unsigned long long)app->commands, (unsigned long long)app->errors,
+      (unsigned long long)pool.served, (unsigned long long)pool.refills, (unsigned long long)pool.overflow,
+      pool.mapped_bytes, (unsigned long long)player->reallocs);
+  VLControl_publish(app->control, buf);
+  app->published = now;
+}
+
+static void count_frame(VLApp *app)
+{
+  uint64_t seq = app->player->image->seq;
+  if (seq != app->last_seq) {
+    app->presented++;
+    if (seq > app->last_seq + 1) {
+      app->dropped += seq - app->last_seq - 1;
+    }
+    app->last_seq = seq;
+  }
+}
+
 static int parse_poly_type(const char *type)
 {
   if (!strcmp("cylinder", type)) {
@@ -112,15 +411,123 @@ static int parse_poly_type(const char *type)
   }
 }
 
-int main(int argc, const char *argv[])
+static enum vlgl_stereo parse_stereo(const char *stereo)
+{
+  if (!strcmp("tb", stereo)) {
+    return VLGL_STEREO_TB;
+  } else if (!strcmp("sbs", stereo)) {
+    return VLGL_STEREO_SBS;
+  } else {
+    fprintf(stderr, "Invalid stereo layout, only 'tb' and 'sbs' supported.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static enum vlgl_output parse_output(const char *output)
+{
+  if (!strcmp("mono", output)) {
+    return VLGL_OUTPUT_MONO;
+  } else if (!strcmp("anaglyph", output)) {
+    return VLGL_OUTPUT_ANAGLYPH;
+  } else if (!strcmp("sbs", output)) {
+    return VLGL_OUTPUT_SBS;
+  } else if (!strcmp("tb", output)) {
+    return VLGL_OUTPUT_TB;
+  } else {
+    fprintf(stderr, "Invalid stereo output, only 'mono', 'anaglyph', 'sbs' and 'tb' supported.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static enum vlgl_projection parse_projection(const char *projection)
+{
+  if (!strcmp("stereo", projection)) {
+    return VLGL_PROJECTION_STEREO;
+  } else if (!strcmp("rectilinear", projection)) {
+    return VLGL_PROJECTION_RECTILINEAR;
+  } else {
+    fprintf(stderr, "Invalid projection, only 'stereo' and 'rectilinear' supported.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * A view is given as yaw:fov:projection, any part may be left empty. With
+ * no yaw the view stays tiled next to its neighbours.
+ */
+static void parse_view(VLGL *gl, int i, char *spec, enum vlgl_projection projection)
+{
+  char *yaw = strsep(&spec, ":");
+  char *fov = spec ? strsep(&spec, ":") : NULL;
+
+  VLGL_view(gl, i, *yaw ? atof(yaw) : NAN, fov && *fov ? atof(fov) : 1,
+      spec && *spec ? parse_projection(spec) : projection);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-s tb|sbs] [-o mono|anaglyph|sbs|tb] [-p stereo|rectilinear] [-w views] [-v yaw:fov:projection]... [-l] [-S socket] <panorama-type> <precision> <image-or-video>\n", name);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
 {
   VLGL *gl = NULL;
   VLPlayer *player = NULL;
   GLFWwindow *window = NULL;
+  enum vlgl_stereo stereo = VLGL_STEREO_MONO;
+  enum vlgl_output output = VLGL_OUTPUT_ANAGLYPH;
+  enum vlgl_projection projection = VLGL_PROJECTION_STEREO;
+  int views = 1;
+  char *view_specs[VLGL_VIEWS_MAX];
+  int n_specs = 0;
+  bool low_latency = false;
+  const char *control = NULL;
+  VLPoolStats pool;
+  VLApp app = { .latency = { .name = "input-to-GPU-completion latency" } };
+  double last;
+  int opt;
 
-  if (argc != 4) {
-    fprintf(stderr, "Usage: %s <panorama-type> <precision> <image-or-video>\n", argv[0]);
-    return EXIT_FAILURE;
+  while ((opt = getopt(argc, argv, "s:o:p:w:v:lS:")) != -1) {
+    switch (opt) {
+      case 's':
+        stereo = parse_stereo(optarg);
+        break;
+      case 'o':
+        output = parse_output(optarg);
+        break;
+      case 'p':
+        projection = parse_projection(optarg);
+        break;
+      case 'w':
+        views = atoi(optarg);
+        break;
+      case 'v':
+        if (n_specs < VLGL_VIEWS_MAX) {
+          view_specs[n_specs++] = optarg;
+        }
+        break;
+      case 'l':
+        low_latency = true;
+        break;
+      case 'S':
+        control = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  if (argc - optind != 3) {
+    usage(argv[0]);
+  }
+  argv += optind - 1;
+
+  if (control) {
+    app.control = VLControl_construct(control);
+    if (app.control == NULL) {
+      exit(EXIT_FAILURE);
+    }
   }
 
   glfwSetErrorCallback(error_cb);
@@ -136,21 +543,64 @@ int main(int argc, const char *argv[])
   glfwMakeContextCurrent(window);
   glfwSetKeyCallback(window, key_cb);
   glfwSetScrollCallback(window, scroll_cb);
+  glfwSetMouseButtonCallback(window, mouse_button_cb);
+  glfwSetCursorPosCallback(window, cursor_pos_cb);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_cb);
 
   VLGL_version();
   gl = VLGL_construct(parse_poly_type(argv[1]), atoi(argv[2]));
+  VLGL_stereo(gl, stereo, output);
+  VLGL_projection(gl, projection);
+  VLGL_views(gl, views > n_specs ? views : n_specs);
+  for (int i = 0; i < n_specs; i++) {
+    parse_view(gl, i, view_specs[i], projection);
+  }
   player = VLPlayer_construct(gl, argv[3]);
-  glfwSetWindowUserPointer(window, player);
+  app.player = player;
+  glfwSetWindowUserPointer(window, &app);
+  for (int i = 0; i < VL_FRAMES_MAX; i++) {
+    glGenQueries(1, &(app.frames[i].query));
+  }
+  if (low_latency) {
+    glfwSwapInterval(1);
+  }
 
+  last = glfwGetTime();
   while (!glfwWindowShouldClose(window)) {
-    VLGL_render(gl, player->image);
-    glfwSwapBuffers(window);
+    retire_frames(&app, low_latency ? 0 : VL_FRAMES_MAX - 1);
     glfwPollEvents();
+    if (app.control) {
+      apply_control(&app);
+      if (VLTiming_now() - app.published >= TELEMETRY_MS) {
+        publish_telemetry(&app, VLTiming_now());
+      }
+    }
+    double now = glfwGetTime();
+    double input = latch_input(&app, now, now - last);
+    last = now;
+    count_frame(&app);
+    double start = VLTiming_now();
+    VLGL_render(gl, app.player->image);
+    VLTiming_add(&(app.render), VLTiming_now() - start);
+    present_frame(&app, window, input);
   }
+  if (app.control) {
+    VLControl_destroy(app.control);
+  }
+  retire_frames(&app, 0);
+  for (int i = 0; i < VL_FRAMES_MAX; i++) {
+    glDeleteQueries(1, &(app.frames[i].query));
+  }
+  if (app.latency.count > 0) {
+    VLHistogram_print(&(app.latency), stdout);
+  }
+  VLPool_stats(&pool);
+  printf("frame pool: %llu frames served, %llu refills mapped (%llu beyond capacity), %llu image reallocations\n",
+      (unsigned long long)pool.served, (unsigned long long)pool.refills, (unsigned long long)pool.overflow,
+      (unsigned long long)app.player->reallocs);
 
   VLGL_destroy(gl);
-  VLPlayer_destroy(player);
+  VLPlayer_destroy(app.player);
   glfwDestroyWindow(window);
   glfwTerminate();
   return EXIT_SUCCESS;